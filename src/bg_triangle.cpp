@@ -0,0 +1,185 @@
+//
+//  https://github.com/edmBernard/bg-generation-triangle
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#include <bg_triangle.h>
+
+#include <geometry.hpp>
+#include <libsvg.hpp>
+#include <pipeline.hpp>
+#include <save.hpp>
+#include <storage.hpp>
+#include <triangle.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+using draw::ColoredTriangle;
+using draw::TriangleKind;
+
+// Levels above overflow the triangle count, 6 * 4^level and 2 * 2^level must fit in size_t
+constexpr int maxRegularLevel = (std::numeric_limits<size_t>::digits - 3) / 2;
+constexpr int maxPleasingLevel = std::numeric_limits<size_t>::digits - 2;
+
+// Caller arrays are used in place as ColoredTriangle, both types must share the same layout
+static_assert(std::is_standard_layout_v<ColoredTriangle> && std::is_trivially_copyable_v<ColoredTriangle>,
+              "ColoredTriangle is used in place of bgt_triangle");
+static_assert(sizeof(bgt_triangle) == sizeof(ColoredTriangle) && alignof(bgt_triangle) == alignof(ColoredTriangle),
+              "bgt_triangle and ColoredTriangle must have the same size");
+static_assert(offsetof(ColoredTriangle, vertices) == offsetof(bgt_triangle, vertices) &&
+                  offsetof(ColoredTriangle, kind) == offsetof(bgt_triangle, kind) &&
+                  offsetof(ColoredTriangle, flag) == offsetof(bgt_triangle, flag),
+              "bgt_triangle and ColoredTriangle must have the same field order");
+static_assert(sizeof(TriangleKind) == sizeof(int32_t) && sizeof(int) == sizeof(int32_t),
+              "kind and flag are stored as int32_t in bgt_triangle");
+static_assert(int32_t(TriangleKind::Central) == BGT_CENTRAL && int32_t(TriangleKind::Border) == BGT_BORDER,
+              "TriangleKind values must match bgt_triangle_kind");
+
+// Non-owning buffer over a caller array. Read-only arrays are only passed as const buffers.
+storage::Buffer<ColoredTriangle> view(const bgt_triangle *triangles, size_t count) {
+  return storage::Buffer<ColoredTriangle>::view(reinterpret_cast<ColoredTriangle *>(const_cast<bgt_triangle *>(triangles)), count);
+}
+
+uint32_t toHex(const svg::Color &color) {
+  return (uint32_t(color.r & 0xFF) << 16) | (uint32_t(color.g & 0xFF) << 8) | uint32_t(color.b & 0xFF);
+}
+
+// Exceptions must not cross the C boundary
+template <typename Func>
+bgt_status guarded(Func &&func) noexcept {
+  try {
+    return func();
+  } catch (const std::exception &e) {
+    spdlog::error("{}", e.what());
+    return BGT_ERROR;
+  } catch (...) {
+    return BGT_ERROR;
+  }
+}
+
+template <typename Generator>
+bgt_status generate(size_t expected, bgt_triangle *out, size_t capacity, size_t *count, Generator &&generator) {
+  if (!count)
+    return BGT_INVALID_ARGUMENT;
+  *count = expected;
+  if (!out || capacity < expected)
+    return BGT_BUFFER_TOO_SMALL;
+
+  return guarded([&]() {
+    storage::Buffer<ColoredTriangle> tiling = view(out, expected);
+    generator(tiling);
+    return BGT_OK;
+  });
+}
+
+bgt_status write(const svg::Document &doc, bgt_sink sink, void *user) {
+  const bool success = doc.write([&](std::string_view piece) { return sink(user, piece.data(), piece.size()) == 0; });
+  return success ? BGT_OK : BGT_SINK_ERROR;
+}
+
+} // namespace
+
+extern "C" {
+
+size_t bgt_regular_count(int level) {
+  if (level < 0 || level > maxRegularLevel)
+    return 0;
+  return pipeline::regularCount(level);
+}
+
+size_t bgt_pleasing_count(int level) {
+  if (level < 0 || level > maxPleasingLevel)
+    return 0;
+  return pipeline::pleasingCount(level);
+}
+
+bgt_status bgt_generate_regular(int level, int angle, int canvas_size, size_t memory_limit,
+                                bgt_triangle *out, size_t capacity, size_t *count) {
+  if (level < 0 || level > maxRegularLevel || canvas_size <= 0)
+    return BGT_INVALID_ARGUMENT;
+  return generate(bgt_regular_count(level), out, capacity, count, [&](storage::Buffer<ColoredTriangle> &tiling) {
+    pipeline::generateRegular(level, angle, canvas_size, tiling, storage::MemoryBudget{memory_limit});
+  });
+}
+
+bgt_status bgt_generate_pleasing(int level, int canvas_size, size_t memory_limit,
+                                 bgt_triangle *out, size_t capacity, size_t *count) {
+  if (level < 0 || level > maxPleasingLevel || canvas_size <= 0)
+    return BGT_INVALID_ARGUMENT;
+  return generate(bgt_pleasing_count(level), out, capacity, count, [&](storage::Buffer<ColoredTriangle> &tiling) {
+    pipeline::generatePleasing(level, canvas_size, tiling, storage::MemoryBudget{memory_limit});
+  });
+}
+
+bgt_status bgt_set_random_flags(bgt_triangle *triangles, size_t count) {
+  if (!triangles && count > 0)
+    return BGT_INVALID_ARGUMENT;
+  return guarded([&]() {
+    storage::Buffer<ColoredTriangle> tiling = view(triangles, count);
+    draw::setRandomFlag(tiling);
+    return BGT_OK;
+  });
+}
+
+bgt_status bgt_get_palette(int index, uint32_t palette[BGT_PALETTE_SIZE]) {
+  if (!palette || index < 0 || index > 3)
+    return BGT_INVALID_ARGUMENT;
+  return guarded([&]() {
+    const std::vector<svg::Color> colors = getColorPalette(index);
+    std::transform(colors.begin(), colors.end(), palette, toHex);
+    return BGT_OK;
+  });
+}
+
+bgt_status bgt_interpolate_palette(uint32_t color_begin, uint32_t color_end, uint32_t palette[BGT_PALETTE_SIZE]) {
+  if (!palette)
+    return BGT_INVALID_ARGUMENT;
+  return guarded([&]() {
+    const std::vector<svg::Color> colors = getColorPalette(svg::Color(color_begin), svg::Color(color_end));
+    std::transform(colors.begin(), colors.end(), palette, toHex);
+    return BGT_OK;
+  });
+}
+
+bgt_status bgt_render_regular(const bgt_triangle *tiling, size_t tiling_count,
+                              const bgt_triangle *small_tiling, size_t small_tiling_count,
+                              int canvas_size, const uint32_t palette[BGT_PALETTE_SIZE],
+                              int strokes, int threshold,
+                              bgt_sink sink, void *user) {
+  if (!tiling || tiling_count == 0 || (!small_tiling && small_tiling_count > 0) || !palette || !sink || canvas_size <= 0)
+    return BGT_INVALID_ARGUMENT;
+  return guarded([&]() {
+    const std::vector<svg::Color> colors(palette, palette + BGT_PALETTE_SIZE);
+    const svg::Document doc = renderTiling(view(tiling, tiling_count), view(small_tiling, small_tiling_count),
+                                           canvas_size, colors, strokes != 0, threshold);
+    return write(doc, sink, user);
+  });
+}
+
+bgt_status bgt_render_pleasing(const bgt_triangle *tiling, size_t tiling_count,
+                               int canvas_size, const uint32_t *fill_color, int strokes,
+                               bgt_sink sink, void *user) {
+  if ((!tiling && tiling_count > 0) || !sink || canvas_size <= 0)
+    return BGT_INVALID_ARGUMENT;
+  return guarded([&]() {
+    const std::optional<svg::Color> color = fill_color ? std::optional<svg::Color>(svg::Color(*fill_color)) : std::nullopt;
+    const svg::Document doc = renderTiling(view(tiling, tiling_count), canvas_size, color, strokes != 0);
+    return write(doc, sink, user);
+  });
+}
+
+} // extern "C"
@@ -0,0 +1,92 @@
+//
+//  https://github.com/edmBernard/bg-generation-triangle
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+// C API of the bg-triangle library.
+// Generate a tiling in caller-provided buffers, color it and serialize it to svg
+// in a caller-provided sink, without file I/O. Functions never throw.
+
+#ifndef BG_TRIANGLE_H
+#define BG_TRIANGLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum bgt_status {
+  BGT_OK = 0,
+  BGT_INVALID_ARGUMENT = 1,
+  BGT_BUFFER_TOO_SMALL = 2,
+  BGT_SINK_ERROR = 3,
+  BGT_ERROR = 4,
+} bgt_status;
+
+typedef enum bgt_triangle_kind {
+  BGT_CENTRAL = 0,
+  BGT_BORDER = 1,
+} bgt_triangle_kind;
+
+typedef struct bgt_point {
+  float x;
+  float y;
+} bgt_point;
+
+typedef struct bgt_triangle {
+  bgt_point vertices[3];
+  int32_t kind; // bgt_triangle_kind
+  int32_t flag; // color index in [0, 10]
+} bgt_triangle;
+
+// Number of colors in a palette used by bgt_render_regular
+#define BGT_PALETTE_SIZE 5
+
+// Receive the serialized document in order, piece by piece. Return 0 on success.
+typedef int (*bgt_sink)(void *user, const char *data, size_t size);
+
+// Number of triangles generated for a level (0 if the count does not fit in size_t)
+size_t bgt_regular_count(int level);
+size_t bgt_pleasing_count(int level);
+
+// Generate the tiling in `out`. `count` always receives the number of triangles of the tiling,
+// BGT_BUFFER_TOO_SMALL is returned when `capacity` is not enough (`out` can then be NULL).
+// `angle` rotates the regular pattern by Pi/angle (0: no rotation).
+// Intermediate levels are spilled to temporary files above `memory_limit` bytes (0: no limit),
+// the last level is written directly in `out`.
+bgt_status bgt_generate_regular(int level, int angle, int canvas_size, size_t memory_limit,
+                                bgt_triangle *out, size_t capacity, size_t *count);
+bgt_status bgt_generate_pleasing(int level, int canvas_size, size_t memory_limit,
+                                 bgt_triangle *out, size_t capacity, size_t *count);
+
+// Draw a random color index in [0, 10] for each triangle
+bgt_status bgt_set_random_flags(bgt_triangle *triangles, size_t count);
+
+// Palettes as 0xRRGGBB colors: a predefined one (0: blue1, 1:blue2, 2:red, 3:orange) or an interpolation
+bgt_status bgt_get_palette(int index, uint32_t palette[BGT_PALETTE_SIZE]);
+bgt_status bgt_interpolate_palette(uint32_t color_begin, uint32_t color_end, uint32_t palette[BGT_PALETTE_SIZE]);
+
+// Render the regular pattern: the colored tiling, the one level deeper tiling with holes ([0, 10] 0: no holes)
+bgt_status bgt_render_regular(const bgt_triangle *tiling, size_t tiling_count,
+                              const bgt_triangle *small_tiling, size_t small_tiling_count,
+                              int canvas_size, const uint32_t palette[BGT_PALETTE_SIZE],
+                              int strokes, int threshold,
+                              bgt_sink sink, void *user);
+
+// Render the pleasing pattern, `fill_color` can be NULL to only draw strokes
+bgt_status bgt_render_pleasing(const bgt_triangle *tiling, size_t tiling_count,
+                               int canvas_size, const uint32_t *fill_color, int strokes,
+                               bgt_sink sink, void *user);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // BG_TRIANGLE_H
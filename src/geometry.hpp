@@ -13,6 +13,7 @@
 #include <fmt/format.h>
 
 #include <array>
+#include <cmath>
 #include <optional>
 #include <string>
 #include <vector>
@@ -33,43 +34,76 @@ struct Point {
   }
 };
 
-Point operator+(const Point &pt1, const Point &pt2) {
+inline Point operator+(const Point &pt1, const Point &pt2) {
   return {pt1.x + pt2.x, pt1.y + pt2.y};
 }
-Point operator-(const Point &pt1, const Point &pt2) {
+inline Point operator-(const Point &pt1, const Point &pt2) {
   return {pt1.x - pt2.x, pt1.y - pt2.y};
 }
-Point operator*(float value, const Point &pt) {
+inline Point operator*(float value, const Point &pt) {
   return {value * pt.x, value * pt.y};
 }
-Point operator*(const Point &pt, float value) {
+inline Point operator*(const Point &pt, float value) {
   return {value * pt.x, value * pt.y};
 }
-Point operator/(const Point &pt, float value) {
+inline Point operator/(const Point &pt, float value) {
   return {pt.x / value, pt.y / value};
 }
-float scalar(const Point &pt1, const Point &pt2) {
+inline float scalar(const Point &pt1, const Point &pt2) {
   return pt1.x * pt2.x + pt1.y * pt2.y;
 }
-float norm(const Point &pt1) {
-  return std::sqrt(pt1.x * pt1.x + pt1.y * pt1.y);
+inline float squaredNorm(const Point &pt1) {
+  return pt1.x * pt1.x + pt1.y * pt1.y;
 }
-bool operator==(const Point &lhs, const Point &rhs) {
-  return norm(lhs - rhs) < epsilon;
+inline float norm(const Point &pt1) {
+  return std::sqrt(squaredNorm(pt1));
 }
-bool operator<(const Point &lhs, const Point &rhs) {
-  if (abs(lhs.x - rhs.x) < epsilon)
+inline bool operator==(const Point &lhs, const Point &rhs) {
+  return squaredNorm(lhs - rhs) < epsilon * epsilon;
+}
+inline bool operator<(const Point &lhs, const Point &rhs) {
+  if (std::abs(lhs.x - rhs.x) < epsilon)
     return lhs.y < rhs.y;
   return lhs.x < rhs.x;
 }
-Point rotate(const Point &lhs, float angle) {
-  return { lhs.x * std::cos(angle) - lhs.y * std::sin(angle), lhs.x * std::sin(angle) + lhs.y * std::cos(angle)};
+// Rotation with precomputed cosinus and sinus of the angle
+inline Point rotate(const Point &lhs, float cosAngle, float sinAngle) {
+  return {lhs.x * cosAngle - lhs.y * sinAngle, lhs.x * sinAngle + lhs.y * cosAngle};
+}
+inline Point rotate(const Point &lhs, float angle) {
+  return rotate(lhs, std::cos(angle), std::sin(angle));
 }
 
-std::string to_string(const Point &pt) {
+inline std::string to_string(const Point &pt) {
   return fmt::format("({}, {})", pt.x, pt.y);
 }
 
+//------------------------------------------------------------------------------
+// Batch transforms on a range of points
+// Plain loops without branches over contiguous points so the compiler can vectorize them
+
+inline void translate(Point *first, Point *last, const Point &offset) {
+  for (; first != last; ++first) {
+    first->x += offset.x;
+    first->y += offset.y;
+  }
+}
+
+inline void scale(Point *first, Point *last, float factor) {
+  for (; first != last; ++first) {
+    first->x *= factor;
+    first->y *= factor;
+  }
+}
+
+inline void rotate(Point *first, Point *last, float angle) {
+  const float cosAngle = std::cos(angle);
+  const float sinAngle = std::sin(angle);
+  for (; first != last; ++first) {
+    *first = rotate(*first, cosAngle, sinAngle);
+  }
+}
+
 //------------------------------------------------------------------------------
 // Triangle
 struct Triangle {
@@ -79,18 +113,18 @@ struct Triangle {
       : vertices{A, B, C} {
   }
 
-  Point center() {
-    return (this->vertices[0] + this->vertices[1] + this->vertices[2]) / 3.;
+  Point center() const {
+    return (this->vertices[0] + this->vertices[1] + this->vertices[2]) / 3.f;
   }
 };
 
-bool operator==(const Triangle &lhs, const Triangle &rhs) {
+inline bool operator==(const Triangle &lhs, const Triangle &rhs) {
   return rhs.vertices[0] == lhs.vertices[0] &&
          rhs.vertices[1] == lhs.vertices[1] &&
          rhs.vertices[2] == lhs.vertices[2];
 }
 
-std::string to_string(const Triangle &triangle) {
+inline std::string to_string(const Triangle &triangle) {
   return fmt::format("{}, {}, {}", to_string(triangle.vertices[0]), to_string(triangle.vertices[1]), to_string(triangle.vertices[2]));
 }
 
@@ -104,21 +138,21 @@ struct Quadrilateral {
   }
 
   Point center() const {
-    return (this->vertices[0] + this->vertices[1] + this->vertices[2] + this->vertices[3]) / 4.;
+    return (this->vertices[0] + this->vertices[1] + this->vertices[2] + this->vertices[3]) / 4.f;
   }
 };
 
-bool operator==(const Quadrilateral &lhs, const Quadrilateral &rhs) {
+inline bool operator==(const Quadrilateral &lhs, const Quadrilateral &rhs) {
   // we compare gravity center approximative be enough
   return lhs.center() == rhs.center();
 }
 
-bool operator<(const Quadrilateral &lhs, const Quadrilateral &rhs) {
+inline bool operator<(const Quadrilateral &lhs, const Quadrilateral &rhs) {
   // we compare gravity center approximative be enough
   return lhs.center() < rhs.center();
 }
 
-std::string to_string(const Quadrilateral &quad) {
+inline std::string to_string(const Quadrilateral &quad) {
   return fmt::format("{}, {}, {}, {}", to_string(quad.vertices[0]), to_string(quad.vertices[1]), to_string(quad.vertices[2]), to_string(quad.vertices[3]));
 }
 
@@ -132,16 +166,13 @@ struct Bezier {
   }
 };
 
-Bezier rotate(const Bezier &lhs, float angle) {
-  return {
-    rotate(lhs.points[0], angle),
-    rotate(lhs.points[1], angle),
-    rotate(lhs.points[2], angle),
-    rotate(lhs.points[3], angle)
-    };
+inline Bezier rotate(const Bezier &lhs, float angle) {
+  Bezier rotated = lhs;
+  rotate(rotated.points.data(), rotated.points.data() + rotated.points.size(), angle);
+  return rotated;
 }
 
-std::string to_string(const Bezier &bz) {
+inline std::string to_string(const Bezier &bz) {
   return fmt::format("{}, {}, {}, {}",
     to_string(bz.points[0]), to_string(bz.points[1]), to_string(bz.points[2]), to_string(bz.points[3]));
 }
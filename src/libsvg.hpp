@@ -2,12 +2,32 @@
 #pragma once
 
 #include "geometry.hpp"
+#include "parallel.hpp"
+#include "storage.hpp"
 
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 namespace svg {
 
@@ -26,16 +46,16 @@ struct Color {
 };
 
 // Color operation use for color interpolation
-Color operator+(const Color &c1, const Color &c2) {
+inline Color operator+(const Color &c1, const Color &c2) {
   return {c1.r + c2.r, c1.g + c2.g, c1.b + c2.b};
 }
-Color operator-(const Color &c1, const Color &c2) {
+inline Color operator-(const Color &c1, const Color &c2) {
   return {c1.r - c2.r, c1.g - c2.g, c1.b - c2.b};
 }
-Color operator*(float value, const Color &c) {
+inline Color operator*(float value, const Color &c) {
   return {int(value * c.r), int(value * c.g), int(value * c.b)};
 }
-float norm(const Color &c1) {
+inline float norm(const Color &c1) {
   return c1.r * c1.r + c1.g * c1.g + c1.b * c1.b;
 }
 
@@ -60,93 +80,398 @@ struct Stroke : public Color {
 
 namespace details {
 
-std::string to_draw(const Triangle &tr) {
-  return fmt::format("M {} {} L {} {} L {} {} Z", tr.vertices[2].x, tr.vertices[2].y, tr.vertices[0].x, tr.vertices[0].y, tr.vertices[1].x, tr.vertices[1].y);
+// Upper bound on the characters needed by the shortest representation of a float,
+// reached in fixed notation just below 1e16 (ex: -1234567800000000)
+constexpr size_t maxFloatSize = 17;
+// Upper bound on the characters of a <path> element without its 'd' attribute content
+constexpr size_t maxPathElementSize = 256;
+
+// Append-only buffer made of large blocks.
+// Growing allocates a new block and never moves or copies the bytes already written.
+// Blocks are spilled to temporary files when keeping them in memory on top of the `used`
+// bytes would exceed the budget, spilled bytes are dropped from memory as they are written.
+class ChunkedBuffer {
+public:
+  static constexpr size_t blockSize = 16 * 1024 * 1024;
+
+  struct Block {
+    storage::Buffer<char> data;
+    size_t size = 0;
+  };
+
+  ChunkedBuffer() = default;
+  ChunkedBuffer(const storage::MemoryBudget &budget, size_t used)
+      : budget(budget), used(used) {
+  }
+
+  void append(const char *data, size_t size) {
+    while (size > 0) {
+      if (current == blocks.size() || blocks[current].size == blocks[current].data.size()) {
+        if (current < blocks.size())
+          ++current;
+        if (current == blocks.size())
+          addBlock(blockSize);
+      }
+      Block &block = blocks[current];
+      const size_t count = std::min(size, block.data.size() - block.size);
+      std::memcpy(block.data.data() + block.size, data, count);
+      const size_t previous = block.size;
+      block.size += count;
+      // spilled blocks are released by whole steps of blockSize bytes once written
+      if (block.data.isSpilled() && block.size / blockSize > previous / blockSize)
+        block.data.release(previous / blockSize * blockSize, block.size / blockSize * blockSize);
+      totalSize += count;
+      data += count;
+      size -= count;
+    }
+  }
+
+  void append(std::string_view str) {
+    append(str.data(), str.size());
+  }
+
+  // Allocate upfront enough space to append `size` more bytes without any allocation
+  void reserve(size_t size) {
+    size_t available = 0;
+    for (size_t i = current; i < blocks.size(); ++i)
+      available += blocks[i].data.size() - blocks[i].size;
+    if (available < size)
+      addBlock(size - available);
+  }
+
+  size_t size() const {
+    return totalSize;
+  }
+
+  // Blocks in write order, the last ones can be empty if more was reserved than written
+  const std::vector<Block> &data() const {
+    return blocks;
+  }
+
+private:
+  void addBlock(size_t capacity) {
+    size_t resident = used;
+    for (const auto &block : blocks)
+      resident += block.data.residentBytes();
+    const bool spill = budget.exceeded(resident, capacity);
+    // spilled blocks grow geometrically to keep the number of temporary files low
+    if (spill)
+      capacity = std::max(capacity, totalSize);
+    blocks.push_back(Block{storage::Buffer<char>(capacity, spill), 0});
+  }
+
+  storage::MemoryBudget budget;
+  size_t used = 0;
+  std::vector<Block> blocks;
+  size_t current = 0;
+  size_t totalSize = 0;
+};
+
+inline void to_draw(fmt::memory_buffer &out, const Triangle &tr) {
+  fmt::format_to(std::back_inserter(out), "M {} {} L {} {} L {} {} Z", tr.vertices[2].x, tr.vertices[2].y, tr.vertices[0].x, tr.vertices[0].y, tr.vertices[1].x, tr.vertices[1].y);
 }
 
-std::string to_draw(const Quadrilateral &tr) {
-  return fmt::format("M {} {} L {} {} L {} {} L {} {} Z", tr.vertices[0].x, tr.vertices[0].y, tr.vertices[1].x, tr.vertices[1].y, tr.vertices[3].x, tr.vertices[3].y, tr.vertices[2].x, tr.vertices[2].y);
+inline void to_draw(fmt::memory_buffer &out, const Quadrilateral &tr) {
+  fmt::format_to(std::back_inserter(out), "M {} {} L {} {} L {} {} L {} {} Z", tr.vertices[0].x, tr.vertices[0].y, tr.vertices[1].x, tr.vertices[1].y, tr.vertices[3].x, tr.vertices[3].y, tr.vertices[2].x, tr.vertices[2].y);
 }
 
-std::string to_draw(const Bezier &bz) {
-  return fmt::format("M {} {} C {} {}, {} {}, {} {}",
-                     bz.points[0].x, bz.points[0].y,
-                     bz.points[1].x, bz.points[1].y,
-                     bz.points[2].x, bz.points[2].y,
-                     bz.points[3].x, bz.points[3].y);
+inline void to_draw(fmt::memory_buffer &out, const Bezier &bz) {
+  fmt::format_to(std::back_inserter(out), "M {} {} C {} {}, {} {}, {} {}",
+                 bz.points[0].x, bz.points[0].y,
+                 bz.points[1].x, bz.points[1].y,
+                 bz.points[2].x, bz.points[2].y,
+                 bz.points[3].x, bz.points[3].y);
 }
 
-std::string to_style(std::optional<Fill> fill) {
-  return fill ? fmt::format("fill:rgb({},{},{})", fill->r, fill->g, fill->b) : "fill:none";
+inline void to_style(fmt::memory_buffer &out, std::optional<Fill> fill) {
+  if (fill)
+    fmt::format_to(std::back_inserter(out), "fill:rgb({},{},{})", fill->r, fill->g, fill->b);
+  else
+    fmt::format_to(std::back_inserter(out), "fill:none");
+}
+
+inline void to_style(fmt::memory_buffer &out, std::optional<Stroke> stroke) {
+  if (stroke)
+    fmt::format_to(std::back_inserter(out), "stroke:rgb({},{},{});stroke-width:{};stroke-opacity:{};stroke-linecap:butt;stroke-linejoin:round", stroke->r, stroke->g, stroke->b, stroke->width, stroke->opacity);
+}
+
+#ifndef _WIN32
+// Write all pieces at the current file position with scatter I/O, retrying on partial writes.
+// Each call writes at most maxBatchSize bytes and `written(index)` is called once a piece is fully written.
+inline bool writeScattered(int fd, const std::vector<std::string_view> &pieces, const std::function<void(size_t)> &written = {}) {
+  constexpr size_t maxBatchSize = 64 * 1024 * 1024;
+
+  std::vector<iovec> iov;
+  std::vector<size_t> indices;
+  iov.reserve(pieces.size());
+  indices.reserve(pieces.size());
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    if (!pieces[i].empty()) {
+      iov.push_back({const_cast<char *>(pieces[i].data()), pieces[i].size()});
+      indices.push_back(i);
+    }
+  }
+
+  size_t first = 0;
+  while (first < iov.size()) {
+    size_t count = 0;
+    for (size_t batchSize = 0; first + count < iov.size() && count < IOV_MAX && (count == 0 || batchSize < maxBatchSize); ++count)
+      batchSize += iov[first + count].iov_len;
+    const ssize_t result = ::writev(fd, iov.data() + first, int(count));
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    // skip fully written pieces and advance in the partially written one
+    size_t remaining = result;
+    while (first < iov.size() && remaining >= iov[first].iov_len) {
+      remaining -= iov[first].iov_len;
+      if (written)
+        written(indices[first]);
+      ++first;
+    }
+    if (remaining > 0) {
+      iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + remaining;
+      iov[first].iov_len -= remaining;
+    }
+  }
+  return true;
 }
+#endif
+
+// Write all pieces in the file with scatter I/O. On Linux a regular file is first preallocated
+// to the exact output size so its blocks are reserved at once, other targets (pipes, devices)
+// are written as a stream. `written(index)` is called once a piece is fully written.
+inline bool writeFile(const std::vector<std::string_view> &pieces, const std::filesystem::path &filename, const std::function<void(size_t)> &written = {}) {
+#ifdef _WIN32
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+    return false;
+  for (size_t i = 0; i < pieces.size() && out; ++i) {
+    out.write(pieces[i].data(), pieces[i].size());
+    if (out && written)
+      written(i);
+  }
+  return bool(out);
+#else
+  const int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  size_t totalSize = 0;
+  for (const auto &piece : pieces)
+    totalSize += piece.size();
+
+#ifdef __linux__
+  // fallocate rather than posix_fallocate: without native support glibc emulates the latter by
+  // writing every block once, here those file systems are simply written without preallocation
+  struct stat status;
+  if (totalSize > 0 && ::fstat(fd, &status) == 0 && S_ISREG(status.st_mode)) {
+    if (::fallocate(fd, 0, 0, totalSize) != 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+      spdlog::debug("Cannot preallocate {} bytes in the output file : {}.", totalSize, std::strerror(errno));
+  }
+#endif
 
-std::string to_style(std::optional<Stroke> stroke) {
-  return stroke ? fmt::format("stroke:rgb({},{},{});stroke-width:{};stroke-opacity:{};stroke-linecap:butt;stroke-linejoin:round", stroke->r, stroke->g, stroke->b, stroke->width, stroke->opacity) : "";
+  const bool success = writeScattered(fd, pieces, written);
+  return ::close(fd) == 0 && success;
+#endif
 }
 
 } // namespace details
 
 class Document {
 public:
-  Document(int canvasWidth, int canvasHeight, Color background)
+  // The content is spilled to temporary files when it does not fit in the budget next to the `used` bytes
+  Document(int canvasWidth, int canvasHeight, Color background, const storage::MemoryBudget &budget = {}, size_t used = 0)
       : canvasWidth(canvasWidth),
         canvasHeight(canvasHeight),
-        backgroundColor(background) {
+        backgroundColor(background),
+        content(budget, used) {
   }
 
-  [[nodiscard]] bool save(std::filesystem::path filename) {
+  [[nodiscard]] bool save(std::filesystem::path filename) const {
+    const std::string head = header();
+    std::vector<std::string_view> pieces{head};
+    std::vector<Step> steps{Step{}};
+    for (const Step &step : contentSteps()) {
+      pieces.emplace_back(step.data->data() + step.first, step.last - step.first);
+      steps.push_back(step);
+    }
+    pieces.push_back(footer);
+    steps.emplace_back();
 
-    std::ofstream out(filename);
-    if (!out) {
-      spdlog::error("Cannot open output file : {}.", filename.string());
+    spdlog::debug("Write {} bytes in {}", size(), filename.string());
+    if (!details::writeFile(pieces, filename, [&](size_t piece) { release(steps[piece]); })) {
+      spdlog::error("Cannot write output file : {}.", filename.string());
       return false;
     }
+    return true;
+  }
 
-    out << "<svg xmlns='http://www.w3.org/2000/svg' "
-        << fmt::format("height='{height}' width='{width}' viewBox='0 0 {height} {width}'>\n", fmt::arg("height", canvasHeight), fmt::arg("width", canvasWidth))
-        << fmt::format("<rect height='100%' width='100%' fill='rgb({},{},{})'/>\n", backgroundColor.r, backgroundColor.g, backgroundColor.b)
-        << "<g id='surface1'>\n";
+  // Serialize the document piece by piece in sink(std::string_view) -> bool, stop at the first failure
+  template <typename Sink>
+  [[nodiscard]] bool write(Sink &&sink) const {
+    if (!sink(std::string_view(header())))
+      return false;
+    for (const Step &step : contentSteps()) {
+      if (!sink(std::string_view(step.data->data() + step.first, step.last - step.first)))
+        return false;
+      release(step);
+    }
+    return sink(footer);
+  }
 
-    out << content;
+  // Exact size of the serialized document
+  size_t size() const {
+    return header().size() + content.size() + footer.size();
+  }
 
-    out << "</g>\n</svg>\n";
-    return true;
+  // Preallocate content memory, see pathSizeBound to estimate the size from the shape count
+  void reserve(size_t size) {
+    content.reserve(size);
   }
 
   void addRaw(const std::string &raw) {
-    content += raw;
+    content.append(raw);
   }
 
   void addBezier(const Bezier &bz, Stroke stroke) {
-    const std::string s_stroke = fmt::format("stroke:rgb({},{},{});stroke-width:{};stroke-opacity:{};stroke-linecap:butt;stroke-linejoin:round",
-                                             stroke.r, stroke.g, stroke.b, stroke.width, stroke.opacity);
-
-    content += fmt::format("<path style='{};fill:none' d='{}'></path>\n ", s_stroke, details::to_draw(bz));
+    fmt::memory_buffer buffer;
+    fmt::format_to(std::back_inserter(buffer), "<path style='");
+    details::to_style(buffer, std::optional<Stroke>(stroke));
+    fmt::format_to(std::back_inserter(buffer), ";fill:none' d='");
+    details::to_draw(buffer, bz);
+    fmt::format_to(std::back_inserter(buffer), "'></path>\n ");
+    content.append(buffer.data(), buffer.size());
   }
 
   void addText(const std::string &text, Point position, Fill textColor) {
-    const std::string s_fill = fmt::format("fill:rgb({},{},{})", textColor.r, textColor.g, textColor.b);
-    content += fmt::format("<text style='{}' x={} y={} font-size='0.5em' dy='0.25em'>{}</text>\n", s_fill, position.x, position.y, text);
+    fmt::memory_buffer buffer;
+    fmt::format_to(std::back_inserter(buffer), "<text style='");
+    details::to_style(buffer, std::optional<Fill>(textColor));
+    fmt::format_to(std::back_inserter(buffer), "' x={} y={} font-size='0.5em' dy='0.25em'>{}</text>\n", position.x, position.y, text);
+    content.append(buffer.data(), buffer.size());
   }
 
-
+  // Shapes are formatted in parallel chunks then appended in order, so the output is the same as
+  // a serial loop. The filter `func` is called concurrently and must be thread-safe.
   template <typename T, typename Lambda = std::function<bool(typename T::value_type)>>
   void addPath(const T &shapes, std::optional<Fill> fill, std::optional<Stroke> stroke, Lambda func = [](const typename T::value_type &) { return true; }) {
-    std::string s_path;
-    for (auto &elem : shapes) {
-      if (func(elem)) {
-        s_path += details::to_draw(elem) + " ";
+    fmt::memory_buffer buffer;
+    fmt::format_to(std::back_inserter(buffer), "<path style='");
+    details::to_style(buffer, fill);
+    buffer.push_back(';');
+    details::to_style(buffer, stroke);
+    fmt::format_to(std::back_inserter(buffer), "' d='");
+    content.append(buffer.data(), buffer.size());
+
+    // Shapes are processed by batch to bound the memory used by the chunk buffers.
+    // Two batches alternate: the pool formats one while this thread appends the other.
+    struct Batch {
+      std::vector<fmt::memory_buffer> chunks{parallel::threadCount()};
+      size_t chunkCount = 0;
+      size_t first = 0;
+      size_t last = 0;
+      parallel::TaskGroup group;
+    };
+    parallel::Pool &pool = parallel::Pool::instance();
+    std::array<Batch, 2> batches;
+
+    auto flush = [&](Batch &batch) {
+      pool.wait(batch.group);
+      for (size_t chunk = 0; chunk < batch.chunkCount; ++chunk)
+        content.append(batch.chunks[chunk].data(), batch.chunks[chunk].size());
+      // formatted shapes of a spilled buffer are dropped from memory
+      if (batch.chunkCount > 0)
+        storage::release(shapes, batch.first, batch.last);
+      batch.chunkCount = 0;
+    };
+
+    const size_t batchSize = parallel::threadCount() * 65536;
+    size_t current = 0;
+    try {
+      for (size_t first = 0; first < shapes.size(); first += batchSize, current ^= 1) {
+        Batch &batch = batches[current];
+        const size_t count = std::min(batchSize, shapes.size() - first);
+        batch.chunkCount = parallel::chunkCount(count);
+        batch.first = first;
+        batch.last = first + count;
+        pool.submitChunks(batch.group, count, [&batch, &shapes, &func, first](size_t chunk, size_t begin, size_t end) {
+          fmt::memory_buffer &out = batch.chunks[chunk];
+          out.clear();
+          for (size_t i = first + begin; i < first + end; ++i) {
+            if (func(shapes[i])) {
+              details::to_draw(out, shapes[i]);
+              out.push_back(' ');
+            }
+          }
+        });
+        flush(batches[current ^ 1]);
       }
+      flush(batches[current ^ 1]);
+    } catch (...) {
+      // tasks still reference the batches, let them finish before unwinding
+      for (auto &batch : batches) {
+        try {
+          pool.wait(batch.group);
+        } catch (...) {
+        }
+      }
+      throw;
     }
-    content += fmt::format("<path style='{};{}' d='{}'></path>\n", details::to_style(fill), details::to_style(stroke), s_path);
-  }
 
+    content.append(std::string_view("'></path>\n"));
+  }
 
 private:
+  static constexpr std::string_view footer = "</g>\n</svg>\n";
+
+  // Range of a content block written at once
+  struct Step {
+    const storage::Buffer<char> *data = nullptr;
+    size_t first = 0;
+    size_t last = 0;
+  };
+
+  // Content split in steps, spilled blocks by blockSize bytes so each step is dropped from memory once written
+  std::vector<Step> contentSteps() const {
+    std::vector<Step> steps;
+    for (const auto &block : content.data()) {
+      const size_t stepSize = block.data.isSpilled() ? details::ChunkedBuffer::blockSize : block.size;
+      for (size_t first = 0; first < block.size; first += stepSize)
+        steps.push_back({&block.data, first, std::min(block.size, first + stepSize)});
+    }
+    return steps;
+  }
+
+  static void release(const Step &step) {
+    if (step.data)
+      step.data->release(step.first, step.last);
+  }
+
+  std::string header() const {
+    return fmt::format(
+        "<svg xmlns='http://www.w3.org/2000/svg' height='{height}' width='{width}' viewBox='0 0 {height} {width}'>\n"
+        "<rect height='100%' width='100%' fill='rgb({r},{g},{b})'/>\n"
+        "<g id='surface1'>\n",
+        fmt::arg("height", canvasHeight), fmt::arg("width", canvasWidth),
+        fmt::arg("r", backgroundColor.r), fmt::arg("g", backgroundColor.g), fmt::arg("b", backgroundColor.b));
+  }
+
   int canvasWidth;
   int canvasHeight;
   Color backgroundColor;
-  std::string content = "";
+  details::ChunkedBuffer content;
 };
 
+// Upper bound on the bytes added by `pathCount` calls to addPath drawing `shapeCount` shapes in total
+template <typename Shape>
+size_t pathSizeBound(size_t shapeCount, size_t pathCount = 1) {
+  constexpr size_t pointCount = std::tuple_size<decltype(Shape::vertices)>::value;
+  // each point is written as " L x y" and the shape is closed with " Z "
+  constexpr size_t shapeSize = pointCount * (4 + 2 * details::maxFloatSize) + 3;
+  return pathCount * details::maxPathElementSize + shapeCount * shapeSize;
+}
+
 } // namespace svg
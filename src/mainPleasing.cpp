@@ -11,7 +11,9 @@
 #include <geometry.hpp>
 #include <triangle.hpp>
 #include <libsvg.hpp>
+#include <pipeline.hpp>
 #include <save.hpp>
+#include <storage.hpp>
 
 #include <cxxopts.hpp>
 #include <spdlog/cfg/env.h>
@@ -39,6 +41,7 @@ int main(int argc, char *argv[]) try {
     ("colorEnd", "Last color in hex format", cxxopts::value<std::string>())
     ("color", "Color palette (0: blue1, 1:blue2, 2:red, 3:orange)", cxxopts::value<int>()->default_value("0"))
     ("strokes", "Draw Strokes", cxxopts::value<bool>())
+    ("memory-limit", "Memory limit in MB, tilings and the svg document are spilled to temporary files beyond it (0: no limit)", cxxopts::value<size_t>()->default_value("0"))
     ;
   // clang-format on
   options.parse_positional({"output", "level", "color"});
@@ -64,6 +67,7 @@ int main(int argc, char *argv[]) try {
   const int level = clo["level"].as<int>();
   const bool showStrokes = clo.count("strokes");
   const std::string filename = clo["output"].as<std::string>();
+  const storage::MemoryBudget budget{clo["memory-limit"].as<size_t>() * 1024 * 1024};
 
   // =================================================================================================
   // Code
@@ -72,19 +76,9 @@ int main(int argc, char *argv[]) try {
 
   auto start_temp = std::chrono::high_resolution_clock::now();
 
-  std::vector<ColoredTriangle> tiling;
-
   const int canvasSize = 2000;
-  const float radius = canvasSize;
-  const Point center = canvasSize / 2.f * Point(1, 1);
-
-  // Tiling initialisation
-  tiling.emplace_back(TriangleKind::Border, radius * Point(1, 0), radius * Point(0, 0), radius * Point(0, 1));
-  tiling.emplace_back(TriangleKind::Border, radius * Point(1, 0), radius * Point(1, 1), radius * Point(0, 1));
 
-  for (int l = 0; l < level; ++l) {
-    tiling = deflatePleasing(tiling);
-  }
+  storage::Buffer<ColoredTriangle> tiling = pipeline::generatePleasing(level, canvasSize, budget);
 
   setRandomFlag(tiling);
 
@@ -97,7 +91,7 @@ int main(int argc, char *argv[]) try {
   //   colorPalette = getColorPalette(svg::Color(colorBegin), svg::Color(colorEnd));
   // }
 
-  if (!saveTiling(filename, tiling, canvasSize, {}, showStrokes)) {
+  if (!saveTiling(filename, tiling, canvasSize, {}, showStrokes, budget)) {
     spdlog::error("Failed to save in file");
     return EXIT_FAILURE;
   }
@@ -11,7 +11,9 @@
 #include <geometry.hpp>
 #include <triangle.hpp>
 #include <libsvg.hpp>
+#include <pipeline.hpp>
 #include <save.hpp>
+#include <storage.hpp>
 
 #include <cxxopts.hpp>
 #include <spdlog/cfg/env.h>
@@ -41,6 +43,7 @@ int main(int argc, char *argv[]) try {
     ("color", "Color palette (0: blue1, 1:blue2, 2:red, 3:orange)", cxxopts::value<int>()->default_value("0"))
     ("threshold", "Threshold for holes [0, 10] (0: no holes)", cxxopts::value<int>()->default_value("9"))
     ("strokes", "Draw Strokes", cxxopts::value<bool>())
+    ("memory-limit", "Memory limit in MB, tilings and the svg document are spilled to temporary files beyond it (0: no limit)", cxxopts::value<size_t>()->default_value("0"))
     ;
   // clang-format on
   options.parse_positional({"output", "level", "color"});
@@ -68,6 +71,7 @@ int main(int argc, char *argv[]) try {
   const int angle = clo["angle"].as<int>();
   const bool strokes = clo.count("strokes");
   const std::string filename = clo["output"].as<std::string>();
+  const storage::MemoryBudget budget{clo["memory-limit"].as<size_t>() * 1024 * 1024};
 
   // =================================================================================================
   // Code
@@ -76,28 +80,10 @@ int main(int argc, char *argv[]) try {
 
   auto start_temp = std::chrono::high_resolution_clock::now();
 
-  std::vector<ColoredTriangle> tiling;
-
   const int canvasSize = 2000;
-  const float radius = canvasSize;
-  const Point center = canvasSize / 2.f * Point(1, 1);
-
-  // Tiling initialisation
-  for (int i = 0, sign = -1; i < 6; ++i, sign *= -1) {
-    const float phi1 = (2 * i - sign) * pi / 6 + (angle == 0 ? 0 : pi / angle);
-    const float phi2 = (2 * i + sign) * pi / 6 + (angle == 0 ? 0 : pi / angle);
-
-    tiling.emplace_back(
-        TriangleKind::Border,
-        radius * Point(cos(phi1), sin(phi1)) + center,
-        Point(0, 0) + center,
-        radius * Point(cos(phi2), sin(phi2)) + center);
-  }
 
-  for (int l = 0; l < level; ++l) {
-    tiling = deflateRegular(tiling);
-  }
-  std::vector<ColoredTriangle> smallTiling = deflateRegular(tiling);
+  storage::Buffer<ColoredTriangle> tiling = pipeline::generateRegular(level, angle, canvasSize, budget);
+  storage::Buffer<ColoredTriangle> smallTiling = deflateRegular(tiling, budget);
 
   setRandomFlag(tiling);
   setRandomFlag(smallTiling);
@@ -111,7 +97,7 @@ int main(int argc, char *argv[]) try {
     colorPalette = getColorPalette(svg::Color(colorBegin), svg::Color(colorEnd));
   }
 
-  if (!saveTiling(filename, tiling, smallTiling, canvasSize, colorPalette, strokes, threshold)) {
+  if (!saveTiling(filename, tiling, smallTiling, canvasSize, colorPalette, strokes, threshold, budget)) {
     spdlog::error("Failed to save in file");
     return EXIT_FAILURE;
   }
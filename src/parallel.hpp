@@ -0,0 +1,160 @@
+//
+//  https://github.com/edmBernard/bg-generation-triangle
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace parallel {
+
+inline size_t threadCount() {
+  return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Number of chunks used by forChunks to split `count` elements
+inline size_t chunkCount(size_t count, size_t minChunkSize = 4096) {
+  return std::clamp<size_t>(count / minChunkSize, 1, threadCount());
+}
+
+// Set of tasks submitted to the pool that can be waited on together
+class TaskGroup {
+public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+private:
+  friend class Pool;
+  size_t pending = 0;
+  std::exception_ptr error;
+};
+
+// Worker threads started once and kept alive for the whole process
+class Pool {
+public:
+  explicit Pool(size_t threads) {
+    for (size_t i = 0; i < threads; ++i) {
+      workers.emplace_back([this]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+          taskReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+          if (tasks.empty())
+            return;
+          runOne(lock);
+        }
+      });
+    }
+  }
+
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    taskReady.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Pool shared by all parallel loops, the calling thread also runs tasks while it waits
+  static Pool &instance() {
+    static Pool pool(threadCount() - 1);
+    return pool;
+  }
+
+  // Queue func(chunkIndex, begin, end) for each chunk of [0, count) without waiting.
+  // `func` is copied in each task, what it references must stay alive until the group is waited on.
+  template <typename Func>
+  void submitChunks(TaskGroup &group, size_t count, Func func, size_t minChunkSize = 4096) {
+    const size_t chunks = chunkCount(count, minChunkSize);
+    const size_t chunkSize = (count + chunks - 1) / chunks;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        const size_t begin = std::min(count, chunk * chunkSize);
+        const size_t end = std::min(count, begin + chunkSize);
+        tasks.push_back({&group, [func, chunk, begin, end]() mutable { func(chunk, begin, end); }});
+        ++group.pending;
+      }
+    }
+    taskReady.notify_all();
+  }
+
+  // Run queued tasks until all the tasks of the group are done, rethrow the first task exception
+  void wait(TaskGroup &group) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (group.pending > 0) {
+      if (!tasks.empty())
+        runOne(lock);
+      else
+        taskDone.wait(lock);
+    }
+    if (group.error)
+      std::rethrow_exception(std::exchange(group.error, nullptr));
+  }
+
+private:
+  struct Task {
+    TaskGroup *group;
+    std::function<void()> run;
+  };
+
+  // Pop and run one task, called with the lock held
+  void runOne(std::unique_lock<std::mutex> &lock) {
+    Task task = std::move(tasks.front());
+    tasks.pop_front();
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      task.run();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    if (error && !task.group->error)
+      task.group->error = error;
+    if (--task.group->pending == 0)
+      taskDone.notify_all();
+  }
+
+  std::vector<std::thread> workers;
+  std::deque<Task> tasks;
+  std::mutex mutex;
+  std::condition_variable taskReady;
+  std::condition_variable taskDone;
+  bool stopping = false;
+};
+
+// Split [0, count) in contiguous chunks and call func(chunkIndex, begin, end) on each of them.
+// Chunks are processed concurrently on the shared pool and the call returns once all are done.
+template <typename Func>
+void forChunks(size_t count, Func &&func, size_t minChunkSize = 4096) {
+  if (chunkCount(count, minChunkSize) == 1) {
+    func(size_t(0), size_t(0), count);
+    return;
+  }
+
+  TaskGroup group;
+  Pool::instance().submitChunks(
+      group, count, [&func](size_t chunk, size_t begin, size_t end) { func(chunk, begin, end); }, minChunkSize);
+  Pool::instance().wait(group);
+}
+
+} // namespace parallel
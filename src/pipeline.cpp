@@ -0,0 +1,121 @@
+//
+//  https://github.com/edmBernard/bg-generation-triangle
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#include <pipeline.hpp>
+
+#include <geometry.hpp>
+#include <storage.hpp>
+#include <triangle.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace pipeline {
+
+using namespace draw;
+
+namespace {
+
+std::vector<ColoredTriangle> initialRegular(int angle, int canvasSize) {
+  const float radius = canvasSize;
+  const Point center = canvasSize / 2.f * Point(1, 1);
+
+  // Tiling initialisation
+  // Hexagon corners are placed on the unit circle then rotated, scaled and moved on the canvas at once
+  std::array<Point, 6> corners;
+  for (int k = 0; k < 6; ++k) {
+    const float phi = (2 * k + 1) * pi / 6;
+    corners[k] = Point(std::cos(phi), std::sin(phi));
+  }
+  rotate(corners.data(), corners.data() + corners.size(), angle == 0 ? 0 : pi / angle);
+  scale(corners.data(), corners.data() + corners.size(), radius);
+  translate(corners.data(), corners.data() + corners.size(), center);
+
+  std::vector<ColoredTriangle> initialTiling;
+  for (int i = 0, sign = -1; i < 6; ++i, sign *= -1) {
+    const int k1 = (i - (sign + 1) / 2 + 6) % 6;
+    const int k2 = (i + (sign - 1) / 2 + 6) % 6;
+
+    initialTiling.emplace_back(TriangleKind::Border, corners[k1], center, corners[k2]);
+  }
+  return initialTiling;
+}
+
+std::vector<ColoredTriangle> initialPleasing(int canvasSize) {
+  const float radius = canvasSize;
+
+  // Tiling initialisation
+  std::vector<ColoredTriangle> initialTiling;
+  initialTiling.emplace_back(TriangleKind::Border, radius * Point(1, 0), radius * Point(0, 0), radius * Point(0, 1));
+  initialTiling.emplace_back(TriangleKind::Border, radius * Point(1, 0), radius * Point(1, 1), radius * Point(0, 1));
+  return initialTiling;
+}
+
+// Subdivide `level - 1` times then write the last subdivision in `out`
+template <typename Deflate, typename DeflateInto>
+void subdivideInto(const std::vector<ColoredTriangle> &initialTiling, int level, storage::Buffer<ColoredTriangle> &out,
+                   Deflate &&deflate, DeflateInto &&deflateInto) {
+  if (level == 0) {
+    if (out.size() != initialTiling.size())
+      throw std::runtime_error("Tiling output size mismatch");
+    std::copy(initialTiling.begin(), initialTiling.end(), out.begin());
+    return;
+  }
+  storage::Buffer<ColoredTriangle> tiling(initialTiling);
+  for (int l = 1; l < level; ++l) {
+    tiling = deflate(tiling);
+  }
+  deflateInto(tiling, out);
+}
+
+} // namespace
+
+size_t regularCount(int level) {
+  return size_t(6) << (2 * level);
+}
+
+size_t pleasingCount(int level) {
+  return size_t(2) << level;
+}
+
+storage::Buffer<ColoredTriangle> generateRegular(int level, int angle, int canvasSize, const storage::MemoryBudget &budget) {
+  storage::Buffer<ColoredTriangle> tiling(initialRegular(angle, canvasSize));
+  for (int l = 0; l < level; ++l) {
+    tiling = deflateRegular(tiling, budget);
+  }
+  return tiling;
+}
+
+storage::Buffer<ColoredTriangle> generatePleasing(int level, int canvasSize, const storage::MemoryBudget &budget) {
+  storage::Buffer<ColoredTriangle> tiling(initialPleasing(canvasSize));
+  for (int l = 0; l < level; ++l) {
+    tiling = deflatePleasing(tiling, budget);
+  }
+  return tiling;
+}
+
+void generateRegular(int level, int angle, int canvasSize, storage::Buffer<ColoredTriangle> &out, const storage::MemoryBudget &budget) {
+  subdivideInto(
+      initialRegular(angle, canvasSize), level, out,
+      [&](const storage::Buffer<ColoredTriangle> &tiling) { return deflateRegular(tiling, budget); },
+      [&](const storage::Buffer<ColoredTriangle> &tiling, storage::Buffer<ColoredTriangle> &newList) { deflateRegular(tiling, newList); });
+}
+
+void generatePleasing(int level, int canvasSize, storage::Buffer<ColoredTriangle> &out, const storage::MemoryBudget &budget) {
+  subdivideInto(
+      initialPleasing(canvasSize), level, out,
+      [&](const storage::Buffer<ColoredTriangle> &tiling) { return deflatePleasing(tiling, budget); },
+      [&](const storage::Buffer<ColoredTriangle> &tiling, storage::Buffer<ColoredTriangle> &newList) { deflatePleasing(tiling, newList); });
+}
+
+} // namespace pipeline
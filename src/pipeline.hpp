@@ -0,0 +1,33 @@
+//
+//  https://github.com/edmBernard/bg-generation-triangle
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <storage.hpp>
+#include <triangle.hpp>
+
+namespace pipeline {
+
+// Number of triangles generated for a level
+size_t regularCount(int level);
+size_t pleasingCount(int level);
+
+// Hexagon of 6 triangles, rotated by Pi/angle (0: no rotation), subdivided `level` times with the regular subdivision
+storage::Buffer<draw::ColoredTriangle> generateRegular(int level, int angle, int canvasSize, const storage::MemoryBudget &budget = {});
+
+// Square of 2 triangles subdivided `level` times with the pleasing subdivision
+storage::Buffer<draw::ColoredTriangle> generatePleasing(int level, int canvasSize, const storage::MemoryBudget &budget = {});
+
+// Same as above but the last level is written in `out` that must hold regularCount/pleasingCount triangles.
+// Only the intermediate levels are allocated, and spilled according to the budget.
+void generateRegular(int level, int angle, int canvasSize, storage::Buffer<draw::ColoredTriangle> &out, const storage::MemoryBudget &budget = {});
+void generatePleasing(int level, int canvasSize, storage::Buffer<draw::ColoredTriangle> &out, const storage::MemoryBudget &budget = {});
+
+} // namespace pipeline
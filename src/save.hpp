@@ -12,15 +12,17 @@
 
 #include <geometry.hpp>
 #include <libsvg.hpp>
+#include <storage.hpp>
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <fstream>
 #include <random>
 #include <string>
 #include <vector>
 
-std::vector<svg::Color> getColorPalette(int index) {
+inline std::vector<svg::Color> getColorPalette(int index) {
   switch (index) {
   case 0:
     // blue but too light
@@ -59,7 +61,7 @@ std::vector<svg::Color> getColorPalette(int index) {
   };
 };
 
-std::vector<svg::Color> getColorPalette(svg::Color colorBegin, svg::Color colorEnd) {
+inline std::vector<svg::Color> getColorPalette(svg::Color colorBegin, svg::Color colorEnd) {
   const svg::Color colorDirection = colorEnd - colorBegin;
   const float directionNorm = norm(colorDirection);
   return {
@@ -70,19 +72,36 @@ std::vector<svg::Color> getColorPalette(svg::Color colorBegin, svg::Color colorE
       colorEnd};
 };
 
-template <typename Geometry>
-[[nodiscard]] bool saveTiling(const std::string &filename,
-                              const std::vector<Geometry> &bigGeometry,
-                              const std::vector<Geometry> &smallGeometry,
-                              int canvasSize,
-                              std::vector<svg::Color> palette, bool haveStrokes, int threshold) {
-
-  svg::Document doc(canvasSize, canvasSize, 0x000000);
+template <typename Container>
+svg::Document renderTiling(const Container &bigGeometry,
+                           const Container &smallGeometry,
+                           int canvasSize,
+                           std::vector<svg::Color> palette, bool haveStrokes, int threshold,
+                           const storage::MemoryBudget &budget = {}) {
+  using Geometry = typename Container::value_type;
 
   std::random_device rd;
   std::mt19937 gen(rd());
   std::uniform_int_distribution<> distrib(0, 10);
 
+  // holes are drawn upfront as the path filter is evaluated from several threads
+  size_t used = bigGeometry.residentBytes() + smallGeometry.residentBytes();
+  storage::Buffer<char> isVisible(smallGeometry.size(), budget.exceeded(used, smallGeometry.size()));
+  used += isVisible.residentBytes();
+  storage::forEachIndex(isVisible, [&](size_t i) { isVisible[i] = distrib(gen) >= threshold; });
+
+  // only shapes with a flag in [0, 10] are drawn, and visible ones for the small tiling
+  auto isDrawn = [](const Geometry &tr) { return tr.flag >= 0 && tr.flag <= 10; };
+  size_t bigCount = 0;
+  storage::forEachIndex(bigGeometry, [&](size_t i) { bigCount += isDrawn(bigGeometry[i]); });
+  size_t smallCount = 0;
+  storage::forEachIndex(smallGeometry, [&](size_t i) { smallCount += isVisible[i] && isDrawn(smallGeometry[i]); });
+
+  svg::Document doc(canvasSize, canvasSize, 0x000000, budget, used);
+  doc.reserve(svg::pathSizeBound<Geometry>(bigCount, 11) +
+              svg::pathSizeBound<Geometry>(smallCount, 11) +
+              (haveStrokes ? svg::pathSizeBound<Geometry>(bigGeometry.size()) : 0));
+
   {
     std::vector<int> colorRepartitionBig{2, 2, 2, 2, 3};
     int count = 0;
@@ -98,7 +117,7 @@ template <typename Geometry>
     int count = 0;
     for (int c = 0; c < palette.size(); ++c) {
       for (int i = 0; i < colorRepartitionSmall[c]; ++i, ++count) {
-        doc.addPath(smallGeometry, svg::Fill{palette[c]}, {}, [&](const Geometry &tr) { return tr.flag == count ? distrib(gen) >= threshold : false; });
+        doc.addPath(smallGeometry, svg::Fill{palette[c]}, {}, [&](const Geometry &tr) { return tr.flag == count && isVisible[&tr - smallGeometry.data()]; });
       }
     }
   }
@@ -108,17 +127,30 @@ template <typename Geometry>
     doc.addPath(bigGeometry, {}, svg::Stroke{{0, 0, 0}, strokeWidth});
   }
 
-  return doc.save(filename);
+  return doc;
 }
 
-
-template <typename Geometry>
+template <typename Container>
 [[nodiscard]] bool saveTiling(const std::string &filename,
-                              const std::vector<Geometry> &geometries,
+                              const Container &bigGeometry,
+                              const Container &smallGeometry,
                               int canvasSize,
-                              std::optional<svg::Color> color, bool haveStrokes) {
+                              std::vector<svg::Color> palette, bool haveStrokes, int threshold,
+                              const storage::MemoryBudget &budget = {}) {
+  return renderTiling(bigGeometry, smallGeometry, canvasSize, palette, haveStrokes, threshold, budget).save(filename);
+}
+
 
-  svg::Document doc(canvasSize, canvasSize, 0xF5ECDC);
+template <typename Container>
+svg::Document renderTiling(const Container &geometries,
+                           int canvasSize,
+                           std::optional<svg::Color> color, bool haveStrokes,
+                           const storage::MemoryBudget &budget = {}) {
+  using Geometry = typename Container::value_type;
+
+  svg::Document doc(canvasSize, canvasSize, 0xF5ECDC, budget, geometries.residentBytes());
+  doc.reserve((color ? svg::pathSizeBound<Geometry>(geometries.size()) : 0) +
+              (haveStrokes ? svg::pathSizeBound<Geometry>(geometries.size()) : 0));
 
   if (color)
     doc.addPath(geometries, svg::Fill{color.value()}, {});
@@ -127,5 +159,14 @@ template <typename Geometry>
     doc.addPath(geometries, {}, svg::Stroke{0x000E36, 1});
   }
 
-  return doc.save(filename);
+  return doc;
+}
+
+template <typename Container>
+[[nodiscard]] bool saveTiling(const std::string &filename,
+                              const Container &geometries,
+                              int canvasSize,
+                              std::optional<svg::Color> color, bool haveStrokes,
+                              const storage::MemoryBudget &budget = {}) {
+  return renderTiling(geometries, canvasSize, color, haveStrokes, budget).save(filename);
 }
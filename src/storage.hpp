@@ -0,0 +1,242 @@
+//
+//  https://github.com/edmBernard/bg-generation-triangle
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace storage {
+
+// Number of elements processed between two releases of a spilled buffer
+constexpr size_t streamChunkSize = 1 << 20;
+
+struct MemoryBudget {
+  size_t limit = 0; // in bytes, 0 means no limit
+
+  // True when `bytes` more in memory on top of the `used` ones would exceed the limit
+  bool exceeded(size_t used, size_t bytes) const {
+    return limit != 0 && used + bytes > limit;
+  }
+};
+
+// Fixed-size array of trivially copyable elements stored either in memory or,
+// when spilled, in a memory-mapped temporary file that is removed on close.
+template <typename T>
+class Buffer {
+  static_assert(std::is_trivially_copyable_v<T>, "Buffer elements are copied as raw bytes");
+
+public:
+  using value_type = T;
+
+  Buffer() = default;
+
+  Buffer(size_t count, bool spill)
+      : count(count) {
+    if (count == 0)
+      return;
+    if (spill && map()) {
+      spilled = true;
+      return;
+    }
+    elements = static_cast<T *>(std::malloc(bytes()));
+    if (!elements)
+      throw std::bad_alloc();
+  }
+
+  explicit Buffer(const std::vector<T> &values)
+      : Buffer(values.size(), false) {
+    std::copy(values.begin(), values.end(), elements);
+  }
+
+  // Buffer over `count` elements owned by the caller, they are not freed with the buffer
+  static Buffer view(T *elements, size_t count) {
+    Buffer buffer;
+    buffer.elements = elements;
+    buffer.count = count;
+    buffer.owned = false;
+    return buffer;
+  }
+
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
+  Buffer(Buffer &&other) noexcept {
+    swap(other);
+  }
+
+  Buffer &operator=(Buffer &&other) noexcept {
+    Buffer(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  ~Buffer() {
+    if (!elements || !owned)
+      return;
+#ifndef _WIN32
+    if (spilled) {
+      ::munmap(elements, bytes());
+      ::close(fd);
+      return;
+    }
+#endif
+    std::free(elements);
+  }
+
+  T *data() {
+    return elements;
+  }
+  const T *data() const {
+    return elements;
+  }
+  size_t size() const {
+    return count;
+  }
+  size_t bytes() const {
+    return count * sizeof(T);
+  }
+  bool isSpilled() const {
+    return spilled;
+  }
+
+  T *begin() {
+    return elements;
+  }
+  T *end() {
+    return elements + count;
+  }
+  const T *begin() const {
+    return elements;
+  }
+  const T *end() const {
+    return elements + count;
+  }
+
+  T &operator[](size_t index) {
+    return elements[index];
+  }
+  const T &operator[](size_t index) const {
+    return elements[index];
+  }
+
+  // Bytes kept in process memory by this buffer
+  size_t residentBytes() const {
+    return spilled ? 0 : bytes();
+  }
+
+  // Write back the elements [first, last) to the file and drop them from memory.
+  // They stay readable and are paged in again on the next access. No-op in memory.
+  void release(size_t first, size_t last) const {
+#ifndef _WIN32
+    if (!spilled)
+      return;
+    // only whole pages inside the range are released
+    const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+    const size_t begin = (first * sizeof(T) + pageSize - 1) / pageSize * pageSize;
+    const size_t end = last == count ? bytes() : last * sizeof(T) / pageSize * pageSize;
+    if (begin >= end)
+      return;
+    char *address = reinterpret_cast<char *>(elements) + begin;
+    ::msync(address, end - begin, MS_SYNC);
+    ::madvise(address, end - begin, MADV_DONTNEED);
+    ::posix_fadvise(fd, begin, end - begin, POSIX_FADV_DONTNEED);
+#else
+    (void)first;
+    (void)last;
+#endif
+  }
+
+private:
+  void swap(Buffer &other) noexcept {
+    std::swap(elements, other.elements);
+    std::swap(count, other.count);
+    std::swap(spilled, other.spilled);
+    std::swap(fd, other.fd);
+    std::swap(owned, other.owned);
+  }
+
+  bool map() {
+#ifndef _WIN32
+    std::string path = (std::filesystem::temp_directory_path() / "bg-triangle-XXXXXX").string();
+    fd = ::mkstemp(path.data());
+    if (fd < 0) {
+      spdlog::warn("Cannot create temporary file to spill {} bytes, keep them in memory.", bytes());
+      return false;
+    }
+    // the file is only reachable through the descriptor and removed when it is closed
+    ::unlink(path.c_str());
+    if (::ftruncate(fd, bytes()) != 0) {
+      spdlog::warn("Cannot resize temporary file to {} bytes, keep them in memory.", bytes());
+      ::close(fd);
+      fd = -1;
+      return false;
+    }
+    void *address = ::mmap(nullptr, bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+      spdlog::warn("Cannot map temporary file of {} bytes, keep them in memory.", bytes());
+      ::close(fd);
+      fd = -1;
+      return false;
+    }
+    elements = static_cast<T *>(address);
+    spdlog::debug("Spill {} bytes to {}", bytes(), path);
+    return true;
+#else
+    spdlog::warn("Spilling is not supported on this platform, keep {} bytes in memory.", bytes());
+    return false;
+#endif
+  }
+
+  T *elements = nullptr;
+  size_t count = 0;
+  bool spilled = false;
+  int fd = -1;
+  bool owned = true;
+};
+
+// Release [first, last) of a spilled buffer, no-op for other containers
+template <typename Container>
+void release(const Container &, size_t, size_t) {
+}
+
+template <typename T>
+void release(const Buffer<T> &buffer, size_t first, size_t last) {
+  buffer.release(first, last);
+}
+
+// Call func(index) on each element in order, a spilled buffer is released after each chunk
+// of streamChunkSize elements so a full pass does not bring it back in memory
+template <typename Container, typename Func>
+void forEachIndex(const Container &container, Func &&func) {
+  for (size_t first = 0; first < container.size(); first += streamChunkSize) {
+    const size_t last = std::min(container.size(), first + streamChunkSize);
+    for (size_t i = first; i < last; ++i) {
+      func(i);
+    }
+    release(container, first, last);
+  }
+}
+
+} // namespace storage
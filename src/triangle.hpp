@@ -11,21 +11,30 @@
 #pragma once
 
 #include <geometry.hpp>
+#include <parallel.hpp>
+#include <storage.hpp>
 
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iterator>
+#include <memory>
 #include <stdexcept>
+#include <tuple>
+#include <utility>
 #include <vector>
 #include <random>
 
 namespace draw {
 
-enum class TriangleKind {
+enum class TriangleKind : int32_t {
   Central,
   Border,
 };
 
-std::string to_string(TriangleKind type) {
+inline std::string to_string(TriangleKind type) {
   switch (type) {
     case TriangleKind::Central:
       return "Central";
@@ -36,101 +45,185 @@ std::string to_string(TriangleKind type) {
   return "";
 }
 
-struct ColoredTriangle : Triangle {
+// Vertices are held directly rather than inherited from Triangle so the struct stays
+// standard-layout and can share its layout with bgt_triangle of the C API
+struct ColoredTriangle {
+  std::array<Point, 3> vertices;
   TriangleKind kind;
   int flag;
 
   ColoredTriangle(TriangleKind kind, Point A, Point B, Point C, int flag = false)
-      : Triangle(A, B, C), kind(kind), flag(flag) {
+      : vertices{A, B, C}, kind(kind), flag(flag) {
   }
 
+  operator Triangle() const {
+    return {vertices[0], vertices[1], vertices[2]};
+  }
+
+  Point center() const {
+    return (this->vertices[0] + this->vertices[1] + this->vertices[2]) / 3.f;
+  }
 };
 
-std::string to_string(const ColoredTriangle &triangle) {
+inline std::string to_string(const ColoredTriangle &triangle) {
   return fmt::format("{}, {}, {}, {}", to_string(triangle.kind), to_string(triangle.vertices[0]), to_string(triangle.vertices[1]), to_string(triangle.vertices[2]));
 }
 
-std::vector<ColoredTriangle> deflateRegular(const ColoredTriangle &triangle) {
+inline void deflateRegular(const ColoredTriangle &triangle, ColoredTriangle *out) {
   const Point A = triangle.vertices[0];
   const Point B = triangle.vertices[1];
   const Point C = triangle.vertices[2];
 
-  const Point a = A + ((B - A) + (C - A)) / 2.;
-  const Point b = B + ((A - B) + (C - B)) / 2.;
-  const Point c = C + ((A - C) + (B - C)) / 2.;
-  return std::vector<ColoredTriangle>{
-      {TriangleKind::Border, A, b, c, triangle.flag},
-      {TriangleKind::Border, B, c, a, triangle.flag},
-      {TriangleKind::Border, C, a, b, triangle.flag},
-      {TriangleKind::Central, a, b, c, triangle.flag}};
+  const Point a = A + ((B - A) + (C - A)) / 2.f;
+  const Point b = B + ((A - B) + (C - B)) / 2.f;
+  const Point c = C + ((A - C) + (B - C)) / 2.f;
+  out[0] = {TriangleKind::Border, A, b, c, triangle.flag};
+  out[1] = {TriangleKind::Border, B, c, a, triangle.flag};
+  out[2] = {TriangleKind::Border, C, a, b, triangle.flag};
+  out[3] = {TriangleKind::Central, a, b, c, triangle.flag};
 }
 
-std::vector<ColoredTriangle> deflateRegular(const std::vector<ColoredTriangle> &triangles) {
-  std::vector<ColoredTriangle> newList;
-  for (const auto &triangle : triangles) {
-    const auto small = deflateRegular(triangle);
-    std::move(small.begin(), small.end(), std::back_inserter(newList));
+// Write the 4 children of each triangle in `newList` that must hold 4 times more triangles
+inline void deflateRegular(const storage::Buffer<ColoredTriangle> &triangles, storage::Buffer<ColoredTriangle> &newList) {
+  const size_t count = triangles.size();
+  if (newList.size() != 4 * count)
+    throw std::runtime_error("Regular subdivision output size mismatch");
+
+  for (size_t first = 0; first < count; first += storage::streamChunkSize) {
+    const size_t last = std::min(count, first + storage::streamChunkSize);
+    parallel::forChunks(last - first, [&](size_t, size_t begin, size_t end) {
+      for (size_t i = first + begin; i < first + end; ++i) {
+        deflateRegular(triangles[i], &newList[4 * i]);
+      }
+    });
+    triangles.release(first, last);
+    newList.release(4 * first, 4 * last);
   }
-  return newList;
 }
 
-std::vector<ColoredTriangle> deflatePleasing(const ColoredTriangle &triangle) {
-  const Point A = triangle.vertices[0];
-  const Point B = triangle.vertices[1];
-  const Point C = triangle.vertices[2];
+// The new level is spilled to a temporary file when keeping it in memory next to the
+// input would exceed the budget. Triangles are then processed by streaming chunks.
+inline storage::Buffer<ColoredTriangle> deflateRegular(const storage::Buffer<ColoredTriangle> &triangles, const storage::MemoryBudget &budget = {}) {
+  storage::Buffer<ColoredTriangle> newList(4 * triangles.size(), budget.exceeded(triangles.residentBytes(), 4 * triangles.bytes()));
+  deflateRegular(triangles, newList);
+  return newList;
+}
 
-  float AB = norm(B-A);
-  float AC = norm(C-A);
-  float BC = norm(C-B);
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::normal_distribution<> distrib(0.5, 0.3);
-  const float ratio = std::clamp<double>(distrib(gen), 0.3, 0.7);
+//------------------------------------------------------------------------------
+// Edge split
 
-  if (AB >= AC && AB >= BC) {
-    // Point D is at the middle of the biggest edge
-    const Point D = A + ratio * (B - A);
+// Edge identified by the exact bits of its two endpoints. Neighbours share bit-identical
+// copies of their common vertices, endpoints are sorted so both build the same key.
+struct EdgeKey {
+  uint32_t x0, y0, x1, y1;
+};
 
-    return std::vector<ColoredTriangle>{
-        {TriangleKind::Border, A, D, C, triangle.flag},
-        {TriangleKind::Border, B, D, C, triangle.flag}};
-  }
+inline std::pair<uint32_t, uint32_t> toBits(const Point &pt) {
+  std::pair<uint32_t, uint32_t> bits;
+  std::memcpy(&bits.first, &pt.x, sizeof(float));
+  std::memcpy(&bits.second, &pt.y, sizeof(float));
+  return bits;
+}
 
-  if (AC >= AB && AC >= BC) {
-    // Point D is at the middle of the biggest edge
-    const Point D = A + ratio * (C - A);
+inline EdgeKey makeEdgeKey(const Point &P, const Point &Q) {
+  const auto [px, py] = toBits(P);
+  const auto [qx, qy] = toBits(Q);
+  if (std::tie(px, py) < std::tie(qx, qy))
+    return {px, py, qx, qy};
+  return {qx, qy, px, py};
+}
 
-    return std::vector<ColoredTriangle>{
-        {TriangleKind::Border, A, D, B, triangle.flag},
-        {TriangleKind::Border, C, D, B, triangle.flag}};
-  }
+inline uint64_t hash(const EdgeKey &key, uint64_t seed) {
+  // splitmix64 finalizer on both packed endpoints
+  auto mix = [](uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  };
+  const uint64_t first = (uint64_t(key.x0) << 32) | key.y0;
+  const uint64_t second = (uint64_t(key.x1) << 32) | key.y1;
+  return mix(first ^ mix(second ^ mix(seed)));
+}
 
-  if (BC >= AB && BC >= AC) {
-    const Point D = B + ratio * (C - B);
+// Split ratio of an edge drawn from N(0.5, 0.3) clamped in [0.3, 0.7]. It only depends on
+// the edge and the seed so both neighbours draw the same one without sharing any state.
+inline float splitRatio(const EdgeKey &key, uint64_t seed) {
+  const uint64_t bits = hash(key, seed);
+  // Box-Muller transform of two uniform numbers in (0, 1]
+  const double u1 = ((bits >> 32) + 1) / 4294967296.0;
+  const double u2 = ((bits & 0xFFFFFFFF) + 1) / 4294967296.0;
+  const double normal = std::sqrt(-2 * std::log(u1)) * std::cos(2 * pi * u2);
+  return std::clamp(0.5 + 0.3 * normal, 0.3, 0.7);
+}
 
-    return std::vector<ColoredTriangle>{
-        {TriangleKind::Border, B, D, A, triangle.flag},
-        {TriangleKind::Border, C, D, A, triangle.flag}};
-  }
+// Vertex indices {P, Q, R} of the triangle where PQ is the longest edge and R the opposite vertex
+inline std::array<int, 3> longestEdge(const ColoredTriangle &triangle) {
+  const Point &A = triangle.vertices[0];
+  const Point &B = triangle.vertices[1];
+  const Point &C = triangle.vertices[2];
+
+  const float AB = norm(B - A);
+  const float AC = norm(C - A);
+  const float BC = norm(C - B);
+
+  if (AB >= AC && AB >= BC)
+    return {0, 1, 2};
+  if (AC >= AB && AC >= BC)
+    return {0, 2, 1};
+  if (BC >= AB && BC >= AC)
+    return {1, 2, 0};
   throw std::runtime_error("I miss something it should not happen");
 }
 
-std::vector<ColoredTriangle> deflatePleasing(const std::vector<ColoredTriangle> &triangles) {
-  std::vector<ColoredTriangle> newList;
-  for (const auto &triangle : triangles) {
-    const auto small = deflatePleasing(triangle);
-    std::move(small.begin(), small.end(), std::back_inserter(newList));
+// Split each triangle on its longest edge. The split point of an edge only depends on the edge
+// and on a seed drawn once per call, so both neighbours split it at the same point and the
+// subdivision does not create new gaps along shared edges. Each triangle is processed on its
+// own, in a single streaming pass. The children are written in `newList` that must hold 2 times
+// more triangles.
+inline void deflatePleasing(const storage::Buffer<ColoredTriangle> &triangles, storage::Buffer<ColoredTriangle> &newList) {
+  const size_t count = triangles.size();
+  if (newList.size() != 2 * count)
+    throw std::runtime_error("Pleasing subdivision output size mismatch");
+
+  std::random_device rd;
+  const uint64_t seed = (uint64_t(rd()) << 32) | rd();
+
+  for (size_t first = 0; first < count; first += storage::streamChunkSize) {
+    const size_t last = std::min(count, first + storage::streamChunkSize);
+    parallel::forChunks(last - first, [&](size_t, size_t begin, size_t end) {
+      for (size_t i = first + begin; i < first + end; ++i) {
+        const ColoredTriangle &triangle = triangles[i];
+        const auto [p, q, r] = longestEdge(triangle);
+        const Point &P = triangle.vertices[p];
+        const Point &Q = triangle.vertices[q];
+        // interpolate from the lowest endpoint of the key so the point does not depend on the triangle orientation
+        const bool ordered = toBits(P) < toBits(Q);
+        const Point &from = ordered ? P : Q;
+        const Point &to = ordered ? Q : P;
+        const Point D = from + splitRatio(makeEdgeKey(P, Q), seed) * (to - from);
+        newList[2 * i] = {TriangleKind::Border, P, D, triangle.vertices[r], triangle.flag};
+        newList[2 * i + 1] = {TriangleKind::Border, Q, D, triangle.vertices[r], triangle.flag};
+      }
+    });
+    triangles.release(first, last);
+    newList.release(2 * first, 2 * last);
   }
+}
+
+// The new level is spilled to a temporary file when keeping it in memory next to the
+// input would exceed the budget.
+inline storage::Buffer<ColoredTriangle> deflatePleasing(const storage::Buffer<ColoredTriangle> &triangles, const storage::MemoryBudget &budget = {}) {
+  storage::Buffer<ColoredTriangle> newList(2 * triangles.size(), budget.exceeded(triangles.residentBytes(), 2 * triangles.bytes()));
+  deflatePleasing(triangles, newList);
   return newList;
 }
 
-void setRandomFlag(std::vector<ColoredTriangle> &quadrilaterals) {
+template <typename Container>
+void setRandomFlag(Container &quadrilaterals) {
   std::random_device rd;
   std::mt19937 gen(rd());
   std::uniform_int_distribution<> distrib(0, 10);
-  for (auto &quad : quadrilaterals) {
-    quad.flag = distrib(gen);
-  }
+  storage::forEachIndex(quadrilaterals, [&](size_t i) { quadrilaterals[i].flag = distrib(gen); });
 }
 
 